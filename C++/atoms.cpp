@@ -1,6 +1,6 @@
 #include "atoms.h"
 
-Atoms::Atoms()
+AtomsBase::AtomsBase()
 	: errorflag{error::NO_ERROR},
 	n{0},
 	timestep{0},
@@ -9,3 +9,42 @@ Atoms::Atoms()
 	boxboundaries {{{{'u', 'u'}}, {{'u', 'u'}}, {{'u', 'u'}}}},
 	num_fields{0}
 {}
+
+/** Reset the error flag and header fields to the freshly constructed state.
+ */
+void AtomsBase::clear()
+{
+	errorflag = error::NO_ERROR;
+	n = 0;
+	timestep = 0;
+	box_hi = {{0.0, 0.0, 0.0}};
+	box_lo = {{0.0, 0.0, 0.0}};
+	boxboundaries = {{{{'u', 'u'}}, {{'u', 'u'}}, {{'u', 'u'}}}};
+	num_fields = 0;
+}
+
+/** Reset to the freshly constructed state, emptying all the atom data lists.
+ * The lists keep their allocated memory, so refilling them with a similar
+ * number of atoms doesn't need to allocate again.
+ */
+template<typename Real>
+void BasicAtoms<Real>::clear()
+{
+	AtomsBase::clear();
+
+	f.clear();
+	id.clear();
+	image_flags.clear();
+	mass.clear();
+	mol.clear();
+	q.clear();
+	type.clear();
+	v.clear();
+	x.clear();
+	xs.clear();
+	xsu.clear();
+	xu.clear();
+}
+
+template class BasicAtoms<double>;
+template class BasicAtoms<float>;
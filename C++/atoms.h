@@ -6,10 +6,12 @@
 #include <string>
 #include <vector>
 
-/** Contains all data read from the trajectory in a given timestep. */
-class Atoms {
+/** The parts of a frame which don't depend on the precision of the atom
+ * data: error codes, property names and the frame header fields. */
+class AtomsBase {
 public:
-	Atoms();
+	AtomsBase();
+	void clear();
 	/** Various error types that might occur. */
 	enum class error {
 		NO_ERROR, /**< No error ocurred */
@@ -20,9 +22,15 @@ public:
 		BAD_PROPERTY_COUNT, /**< The number of properties specified by
 				      the user is different to the number in the
 				      datafile. */
-		FILE_CORRUPT, /**< The reported buffer size for a given
-				processor block isn't compatible with the 
+		FILE_CORRUPT, /**< The number of processor blocks is
+				negative, or the reported buffer size for a
+				given block isn't compatible with the
 				reported number of fields. */
+		BAD_ATOM_COUNT, /**< The processor blocks don't add up to the
+				  number of atoms in the frame header. */
+		BAD_TIMESTEP, /**< The timestep is earlier than the previous
+				frame's (only reported by
+				Trajectory::validate()). */
 	};
 	/** Contains Atoms::error::NO_ERROR if nothing went wrong */
 	error errorflag;
@@ -174,33 +182,53 @@ public:
 	std::array<std::array<char, 2>, 3> boxboundaries;
 	/** The number of fields per atom recorded. */
 	unsigned int num_fields;
+};
+
+/** Contains all data read from the trajectory in a given timestep.
+ * Real is the type in which coordinates, velocities, forces, masses and
+ * charges are stored. The file holds doubles, so with Real = float they are
+ * narrowed as the frame is decoded, halving the memory they take up. Use
+ * Atoms for double precision and AtomsF for single precision.
+ */
+template<typename Real>
+class BasicAtoms : public AtomsBase {
+public:
+	void clear();
 
 	// Atom data lists
 	
 	/** List of atomic forces */
-	std::vector<Vect3<double>> f;
+	std::vector<Vect3<Real>> f;
 	/** List of atom IDs */
 	std::vector<int> id;
 	/** List of atomic image flags */
 	std::vector<Vect3<int>> image_flags;
 	/** List of masses */
-	std::vector<double> mass;
+	std::vector<Real> mass;
 	/** List of molecule IDs */
 	std::vector<int> mol;
 	/** List of atomic charges */
-	std::vector<double> q;
+	std::vector<Real> q;
 	/** List of atom types */
 	std::vector<int> type;
 	/** List of atomic velocities */
-	std::vector<Vect3<double>> v;
+	std::vector<Vect3<Real>> v;
 	/** List of atomic positions */
-	std::vector<Vect3<double>> x;
+	std::vector<Vect3<Real>> x;
 	/** List of atomic positions (scaled) */
-	std::vector<Vect3<double>> xs;
+	std::vector<Vect3<Real>> xs;
 	/** List of atomic positions (scaled and unwrapped) */
-	std::vector<Vect3<double>> xsu;
+	std::vector<Vect3<Real>> xsu;
 	/** List of atomic positions (unwrapped) */
-	std::vector<Vect3<double>> xu;
+	std::vector<Vect3<Real>> xu;
 };
 
+/** Frame data in double precision, as stored in the file */
+typedef BasicAtoms<double> Atoms;
+/** Frame data in single precision */
+typedef BasicAtoms<float> AtomsF;
+
+extern template class BasicAtoms<double>;
+extern template class BasicAtoms<float>;
+
 #endif
@@ -10,22 +10,132 @@
 #include <vector>
 
 #include "trajectory.h"
+#ifdef USE_MPI
+#include "mpitrajectory.h"
+#endif
 
 using namespace std::chrono;
 
+/** Shut down MPI (if in use) and return the exit status. */
+static int finish(int status) {
+#ifdef USE_MPI
+	MPI_Finalize();
+#endif
+	return status;
+}
+
+/** Short description of a frame error, for the --check report. */
+static const char* describe(Atoms::error e) {
+	switch (e) {
+		case Atoms::error::NO_ERROR:
+			return "ok";
+		case Atoms::error::END_OF_FILE:
+			return "end of file";
+		case Atoms::error::FILE_ERROR:
+			return "truncated or unreadable frame";
+		case Atoms::error::TRICLINIC_BOX:
+			return "triclinic box";
+		case Atoms::error::BAD_BOUNDARY:
+			return "bad boundary type";
+		case Atoms::error::BAD_PROPERTY_COUNT:
+			return "wrong number of fields";
+		case Atoms::error::FILE_CORRUPT:
+			return "bad processor block count or block size";
+		case Atoms::error::BAD_ATOM_COUNT:
+			return "blocks don't add up to the atom count";
+		case Atoms::error::BAD_TIMESTEP:
+			return "timestep earlier than the previous frame";
+	}
+	return "unknown error";
+}
+
+/** Validate the frame headers without decoding, and report any problems.
+ * Frames whose timestep goes backwards are intact, so they are listed but
+ * counted separately from the damage.
+ * \return Exit status, nonzero if any frame was damaged.
+ */
+static int check(Trajectory& t) {
+	std::vector<Trajectory::FrameInfo> frames = t.validate();
+	std::size_t bad = 0;
+	std::size_t out_of_order = 0;
+	for (const auto& f : frames) {
+		if (f.error == Atoms::error::NO_ERROR)
+			continue;
+		if (f.error == Atoms::error::BAD_TIMESTEP)
+			++out_of_order;
+		else
+			++bad;
+		std::cout << "Offset " << f.offset << " (timestep " <<
+			f.timestep << "): " << describe(f.error) << std::endl;
+	}
+	std::cout << frames.size() - bad << " intact frames (" <<
+		out_of_order << " with out of order timesteps), " << bad <<
+		" problems found." << std::endl;
+	return bad == 0 ? 0 : 1;
+}
+
 int main(int argc, char** argv) {
+#ifdef USE_MPI
+	MPI_Init(&argc, &argv);
+#endif
 	/* set up the instrumentation */
 
 	high_resolution_clock::time_point start = high_resolution_clock::now();
 	
 	std::string filename(argv[1]);
+	// --check: only validate the file; --recover: skip damaged frames;
+	// --follow: keep reading frames as a running simulation appends them
+	std::string option(argc > 2 ? argv[2] : "");
 
 	std::vector<Atoms::Property> properties = { Atoms::Property::ID,
 		Atoms::Property::TYPE,
 		Atoms::Property::X, Atoms::Property::Y, Atoms::Property::Z};
+	if (option == "--check") {
+		int status = 0;
+#ifdef USE_MPI
+		int rank = 0;
+		MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+		if (rank == 0) {
+#endif
+		Trajectory c(filename, properties);
+		status = check(c);
+#ifdef USE_MPI
+		}
+#endif
+		return finish(status);
+	}
+
+#ifdef USE_MPI
+	// the frames are shared out from a scan of the intact ones, which
+	// can't skip damage or wait for more to be written
+	if (option == "--recover" || option == "--follow") {
+		int rank = 0;
+		MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+		if (rank == 0)
+			std::cerr << option << " is not supported with MPI." <<
+				std::endl;
+		return finish(1);
+	}
+	MPITrajectory t(filename, properties);
+#else
 	Trajectory t(filename, properties);
-	
-	Atoms a = t.readFrame();
+	t.setRecovery(option == "--recover");
+	t.setFollow(option == "--follow");
+#endif
+
+	// one Atoms object is reused for every frame to save reallocating
+	Atoms a;
+	auto next = [&]() {
+#ifndef USE_MPI
+		if (option == "--follow") {
+			// give up once nothing new has turned up for a minute
+			t.waitFrame(a, seconds(1), minutes(1));
+			return;
+		}
+#endif
+		t.readFrame(a);
+	};
+	next();
 	int tsteps_processed = 0;
 	int tsteps_read = 0;
 
@@ -34,9 +144,10 @@ int main(int argc, char** argv) {
 		tsteps_processed++;
 		std::cout << a.timestep << std::endl;
 
-		a = t.readFrame();
+		next();
 	}
 	
+	int status = 0;
 	switch (a.errorflag) {
 		case Atoms::error::NO_ERROR:
 			break;
@@ -49,36 +160,63 @@ int main(int argc, char** argv) {
 		case Atoms::error::TRICLINIC_BOX:
 			std::cerr << "Triclinic boxes are unsupported." <<
 				std::endl;
-			return 1;
+			status = 1;
 			break;
 		case Atoms::error::BAD_BOUNDARY:
 			std::cerr << "Unsupported boundary type (not p,s,f,m)."
 				<< std::endl;
-			return 1;
+			status = 1;
 			break;
 		case Atoms::error::BAD_PROPERTY_COUNT:
 			std::cerr << "The file contains " << a.num_fields <<
 				" fields, but the property vector contains " <<
 				properties.size() << "fields." << std::endl;
-			return 1;
+			status = 1;
 			break;
 		case Atoms::error::FILE_CORRUPT:
-			std::cerr << "The reported buffersize is not "
-				"compatible with the reported number of fields"
-				" per atom" << std::endl;
-			return 1;
+			std::cerr << "The number of processor blocks or a "
+				"reported buffersize is not valid for the "
+				"reported number of fields per atom" <<
+				std::endl;
+			status = 1;
+			break;
+		case Atoms::error::BAD_ATOM_COUNT:
+			std::cerr << "The processor blocks don't add up to the "
+				"number of atoms in the frame" << std::endl;
+			status = 1;
+			break;
+		case Atoms::error::BAD_TIMESTEP:
 			break;
 	}
 
+#ifdef USE_MPI
+	// every rank must get this far before any of them exits, otherwise a
+	// rank which hit an error leaves the others waiting forever in the
+	// collectives
+	if (t.sum(static_cast<uint64_t>(status)) != 0)
+		return finish(1);
+	tsteps_processed = static_cast<int>(
+			t.sum(static_cast<uint64_t>(tsteps_processed)));
+	tsteps_read = static_cast<int>(
+			t.sum(static_cast<uint64_t>(tsteps_read)));
+#else
+	if (status != 0)
+		return finish(1);
+#endif
+
 	high_resolution_clock::time_point end = high_resolution_clock::now();
 
 	duration<double> time_taken =
 		duration_cast<duration<double>>(end-start);
 
+#ifdef USE_MPI
+	if (t.rank() != 0)
+		return finish(0);
+#endif
 	std::cout << "Processed " << tsteps_processed << "/" << tsteps_read << 
 	       " frames in " << time_taken.count() << " seconds. " << std::endl;
 	std::cout << "(" << tsteps_processed / time_taken.count() << " frames per second)" <<
 		std::endl;
 
-	return 0;
+	return finish(0);
 }
@@ -0,0 +1,160 @@
+#ifdef USE_MPI
+
+#include "mpitrajectory.h"
+
+#include <algorithm>
+
+/** Open the trajectory on every rank and decide which frames each rank reads.
+ * This is collective over comm: every rank must construct the object.
+ * \param filename The name of the file containing the trajectory.
+ * \param properties List of the properties to expect for each atom.
+ * Must be in the correct order!
+ * \param comm Communicator whose ranks share the frames.
+ */
+MPITrajectory::MPITrajectory(const std::string& filename,
+		const std::vector<Atoms::Property>& properties,
+		MPI_Comm comm)
+	: comm(comm),
+	rank_(0),
+	size_(1),
+	trajectory(filename, properties),
+	first(0),
+	last(0),
+	next(0)
+{
+	MPI_Comm_rank(comm, &rank_);
+	MPI_Comm_size(comm, &size_);
+
+	// only rank 0 scans the headers, everyone else gets a copy of the
+	// offsets. this keeps the scan to a single pass over the file.
+	std::vector<int64_t> buf;
+	int64_t stopped = -1;
+	if (rank_ == 0) {
+		std::streamoff s;
+		std::vector<std::streamoff> scanned = trajectory.scanFrames(s);
+		buf.assign(scanned.begin(), scanned.end());
+		stopped = s;
+	}
+	uint64_t nframes = buf.size();
+	MPI_Bcast(&nframes, 1, MPI_UINT64_T, 0, comm);
+	MPI_Bcast(&stopped, 1, MPI_INT64_T, 0, comm);
+	buf.resize(nframes);
+	if (nframes > 0)
+		MPI_Bcast(buf.data(), static_cast<int>(nframes), MPI_INT64_T, 0,
+				comm);
+	offsets.assign(buf.begin(), buf.end());
+
+	// contiguous blocks, the first (nframes % size) ranks get one extra
+	uint64_t base = nframes / size_;
+	uint64_t extra = nframes % size_;
+	uint64_t r = static_cast<uint64_t>(rank_);
+	first = r * base + std::min(r, extra);
+	last = first + base + (r < extra ? 1 : 0);
+	next = first;
+
+	// the scan stopped short of the end of the file. the rank with the
+	// last intact frame also reads the one that stopped it, so the error
+	// comes out just as it would from the serial reader.
+	if (stopped >= 0 &&
+			(nframes == 0 ? rank_ == 0 : first < last && last == nframes))
+		++last;
+
+	if (first < last)
+		trajectory.seekFrame(first < nframes ? offsets[first] :
+				static_cast<std::streamoff>(stopped));
+}
+
+/** Read the next frame belonging to this rank.
+ * \return Atoms object as for Trajectory::readFrame(). The errorflag is
+ * Atoms::error::END_OF_FILE once all of this rank's frames have been read.
+ * If the trajectory has a damaged or truncated frame, the rank reading the
+ * last intact frame before it gets that frame's error instead.
+ */
+Atoms MPITrajectory::readFrame()
+{
+	Atoms a;
+	readFrame(a);
+	return a;
+}
+
+/** Read the next frame belonging to this rank into an existing Atoms object,
+ * reusing its memory as for Trajectory::readFrame(BasicAtoms<Real>&).
+ */
+template<typename Real>
+void MPITrajectory::readFrame(BasicAtoms<Real>& a)
+{
+	if (next >= last) {
+		a.clear();
+		a.errorflag = Atoms::error::END_OF_FILE;
+		return;
+	}
+	++next;
+	trajectory.readFrame(a);
+}
+
+/** Sum a value over all ranks.
+ * \return The total, on every rank.
+ */
+double MPITrajectory::sum(double val) const
+{
+	double total = 0.0;
+	MPI_Allreduce(&val, &total, 1, MPI_DOUBLE, MPI_SUM, comm);
+	return total;
+}
+
+/** Sum a count over all ranks.
+ * \return The total, on every rank.
+ */
+uint64_t MPITrajectory::sum(uint64_t val) const
+{
+	uint64_t total = 0;
+	MPI_Allreduce(&val, &total, 1, MPI_UINT64_T, MPI_SUM, comm);
+	return total;
+}
+
+/** Sum a vector elementwise over all ranks, in place. Useful for histograms
+ * and other accumulators. Every rank must pass a vector of the same length.
+ */
+void MPITrajectory::sum(std::vector<double>& vals) const
+{
+	MPI_Allreduce(MPI_IN_PLACE, vals.data(), static_cast<int>(vals.size()),
+			MPI_DOUBLE, MPI_SUM, comm);
+}
+
+/** Sum a vector of counts elementwise over all ranks, in place. Every rank
+ * must pass a vector of the same length.
+ */
+void MPITrajectory::sum(std::vector<uint64_t>& vals) const
+{
+	MPI_Allreduce(MPI_IN_PLACE, vals.data(), static_cast<int>(vals.size()),
+			MPI_UINT64_T, MPI_SUM, comm);
+}
+
+/** Collect frame-wise results from all ranks.
+ * \param local The results for this rank's frames, in the order they were
+ * read. Ranks may pass any number of values.
+ * \return The concatenation of every rank's results in rank order, which is
+ * file order when each rank passes one value per frame. Returned on every
+ * rank.
+ */
+std::vector<double> MPITrajectory::gather(const std::vector<double>& local)
+	const
+{
+	int count = static_cast<int>(local.size());
+	std::vector<int> counts(size_);
+	MPI_Allgather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+
+	std::vector<int> displs(size_, 0);
+	for (int i = 1; i < size_; ++i)
+		displs[i] = displs[i-1] + counts[i-1];
+
+	std::vector<double> all(displs[size_-1] + counts[size_-1]);
+	MPI_Allgatherv(local.data(), count, MPI_DOUBLE, all.data(),
+			counts.data(), displs.data(), MPI_DOUBLE, comm);
+	return all;
+}
+
+template void MPITrajectory::readFrame(Atoms&);
+template void MPITrajectory::readFrame(AtomsF&);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef MPITRAJECTORY_H
+#define MPITRAJECTORY_H
+
+#ifdef USE_MPI
+
+#include <cstdint>
+#include <ios>
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+
+#include "atoms.h"
+#include "trajectory.h"
+
+/** Reads a trajectory in parallel across the ranks of an MPI communicator.
+ * Rank 0 scans the frame headers to find where each frame starts, and the
+ * frames are then split into contiguous blocks, one per rank. Each rank
+ * opens the file independently and reads only its own block, so the ranks
+ * never touch the same bytes. readFrame() behaves like
+ * Trajectory::readFrame(), returning Atoms::error::END_OF_FILE once this
+ * rank's share is exhausted.
+ *
+ * Only the frames up to the first damaged or truncated one are shared out,
+ * as with Trajectory::scanFrames(). The rank holding the last of them reads
+ * the damaged frame too, so its error is reported as by the serial reader.
+ * Recovery and follow mode are not available.
+ *
+ * Because the blocks are contiguous and in rank order, per-frame results can
+ * be put back into file order with gather(). Totals over all frames can be
+ * formed with sum().
+ *
+ * Only available when built with USE_MPI defined (make mpi).
+ */
+class MPITrajectory {
+public:
+	MPITrajectory(const std::string&, const std::vector<Atoms::Property>&,
+			MPI_Comm comm = MPI_COMM_WORLD);
+
+	Atoms readFrame();
+	template<typename Real>
+	void readFrame(BasicAtoms<Real>&);
+	/** Only keep atoms passing the filter, see Trajectory::setFilter() */
+	bool setFilter(const Trajectory::Filter& filter) {
+		return trajectory.setFilter(filter);
+	}
+
+	/** Rank of this process in the communicator */
+	int rank() const { return rank_; }
+	/** Number of ranks in the communicator */
+	int size() const { return size_; }
+	/** Number of intact frames in the whole trajectory */
+	uint64_t totalFrames() const { return offsets.size(); }
+	/** Index of the first frame read by this rank */
+	uint64_t firstFrame() const { return first; }
+	/** Number of frames read by this rank, including a damaged one */
+	uint64_t localFrames() const { return last - first; }
+	/** Index of the frame that the next readFrame() call will return */
+	uint64_t frameIndex() const { return next; }
+
+	double sum(double) const;
+	uint64_t sum(uint64_t) const;
+	void sum(std::vector<double>&) const;
+	void sum(std::vector<uint64_t>&) const;
+	std::vector<double> gather(const std::vector<double>&) const;
+private:
+	MPI_Comm comm;
+	int rank_;
+	int size_;
+	/** Serial reader for this rank's block of frames. */
+	Trajectory trajectory;
+	/** Offset of each frame in the file, identical on every rank. */
+	std::vector<std::streamoff> offsets;
+	/** First frame belonging to this rank */
+	uint64_t first;
+	/** One past the last frame belonging to this rank */
+	uint64_t last;
+	/** Next frame to be read */
+	uint64_t next;
+};
+
+#endif
+
+#endif
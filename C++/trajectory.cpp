@@ -1,5 +1,9 @@
 #include "trajectory.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <thread>
 
 /** Open the specified trajectory file.
  * \param filename The name of the file containing the trajectory.
@@ -9,7 +13,15 @@
 Trajectory::Trajectory(const std::string& filename, 
 		const std::vector<Atoms::Property>& properties)
 	: filename(filename),
-	properties(properties)
+	properties(properties),
+	recover(false),
+	follow(false),
+	filtering(false),
+	resyncs(0),
+	bytes_skipped(0),
+	resync_frame(-1),
+	resync_next(0),
+	file_size(0)
 {
 	file.open(filename.c_str(), std::ios::binary);
 
@@ -73,18 +85,18 @@ Trajectory::Trajectory(const std::string& filename,
 	}
 }
 
-/** Read a single frame from the trajectory.
- * \return Atoms object populated with all  data about the timestep, including
- * an Atoms::error flag which the user must check to ensure that no errors
- * ocurred during the read.
+/** Read the header of the frame at the current file position.
+ * On success the file is left at the start of the first processor block.
+ * \param a Atoms object to receive the header fields. On failure its
+ * errorflag is set.
+ * \param nprocs Set to the number of processor blocks in the frame.
+ * \return true if the header was read without error.
  */
-Atoms Trajectory::readFrame()
+bool Trajectory::readHeader(AtomsBase& a, int& nprocs)
 {
-	Atoms a;
-
 	if (!file.is_open()) {
 		a.errorflag = Atoms::error::FILE_ERROR;
-		return a;
+		return false;
 	}
 
 	file.read(ubi.buf, sizeof(int64_t));
@@ -93,17 +105,260 @@ Atoms Trajectory::readFrame()
 			a.errorflag = Atoms::error::END_OF_FILE;
 		else
 			a.errorflag = Atoms::error::FILE_ERROR;
-		return a;
+		return false;
 	}
 	a.timestep = ubi.i;
 	
 	file.read(ubi.buf, sizeof(int64_t));
 	if (file.fail()) {
 		a.errorflag = Atoms::error::FILE_ERROR;
-		return a;
+		return false;
 	}
 	a.n = ubi.i;
 	
+	file.read(ui.buf, sizeof(int));
+	if (file.fail()) {
+		a.errorflag = Atoms::error::FILE_ERROR;
+		return false;
+	}	
+	if (ui.i != 0) {
+		a.errorflag = Atoms::error::TRICLINIC_BOX;
+		return false;
+	}
+
+	for (int j = 0; j < 2; ++j) {
+		for (int i = 0; i < 3; ++i) {
+			file.read(ui.buf, sizeof(int));
+			if(file.fail()) {
+				a.errorflag = Atoms::error::FILE_ERROR;
+				return false;
+			}
+			if (ui.i == 0)
+				a.boxboundaries[i][j] = 'p';
+			else if (ui.i == 1)
+				a.boxboundaries[i][j] = 'f';
+			else if (ui.i == 2)
+				a.boxboundaries[i][j] = 's';
+			else if (ui.i == 3)
+				a.boxboundaries[i][j] = 'm';
+			else {
+				a.errorflag = Atoms::error::BAD_BOUNDARY;
+				return false;
+			}
+		}
+	}
+
+	std::array<double, 6> box;
+	for (int i = 0; i < 6; ++i) {
+		file.read(ud.buf, sizeof(double));
+		if (file.fail()) {
+			a.errorflag = Atoms::error::FILE_ERROR;
+			return false;
+		}
+		box[i] = ud.d;
+	}
+	a.box_lo[0] = box[0];
+	a.box_lo[1] = box[2];
+	a.box_lo[2] = box[4];
+	a.box_hi[0] = box[1];
+	a.box_hi[1] = box[3];
+	a.box_hi[2] = box[5];
+
+	file.read(ui.buf, sizeof(int));
+	if (file.fail()) {
+		a.errorflag = Atoms::error::FILE_ERROR;
+		return false;
+	}
+
+	a.num_fields = static_cast<unsigned int>(ui.i);
+	if (a.num_fields != properties.size()) {
+		a.errorflag = Atoms::error::BAD_PROPERTY_COUNT;
+		return false;
+	}
+
+	file.read(ui.buf, sizeof(int));
+	if (file.fail()) {
+		a.errorflag = Atoms::error::FILE_ERROR;
+		return false;
+	}
+	nprocs = ui.i; //number of processors used
+	if (nprocs < 0) {
+		a.errorflag = Atoms::error::FILE_CORRUPT;
+		return false;
+	}
+	return true;
+}
+
+/** Read a single frame from the trajectory.
+ * \return Atoms object populated with all  data about the timestep, including
+ * an Atoms::error flag which the user must check to ensure that no errors
+ * ocurred during the read.
+ */
+Atoms Trajectory::readFrame()
+{
+	Atoms a;
+	readFrame(a);
+	return a;
+}
+
+/** Read a single frame from the trajectory into an existing Atoms object.
+ * Any previous contents of a are discarded, but the memory held by its lists
+ * is kept and reused. Reading every frame into the same object therefore
+ * avoids allocating on each frame once the lists have grown to size.
+ * Passing an AtomsF stores the atom data in single precision.
+ * \param a Atoms object to populate, including the Atoms::error flag which
+ * the user must check to ensure that no errors ocurred during the read.
+ */
+template<typename Real>
+void Trajectory::readFrame(BasicAtoms<Real>& a)
+{
+	std::streamoff offset = file.is_open() ? std::streamoff(file.tellg()) : 0;
+	decodeFrame(a, offset);
+
+	while (offset >= 0 && a.errorflag != Atoms::error::NO_ERROR) {
+		// in follow mode, a frame which runs off the end of the file
+		// is normally still being written. in recovery mode, a damaged
+		// frame is skipped. either way, look for an intact frame after
+		// it.
+		bool incomplete = follow && isIncomplete(a);
+		if (!incomplete && !(recover &&
+					isRecoverable(a.errorflag, offset)))
+			break;
+
+		std::streamoff found = 0;
+		if (!findNext(offset, found)) {
+			// nothing intact follows. when following, the frame
+			// may still be being written, or the next intact one
+			// may not have been written yet, so try again next
+			// time.
+			if (follow) {
+				rewind(a, offset);
+				return;
+			}
+			// a layout error with no intact frame after it
+			// probably means the file really isn't laid out as
+			// expected, so report it. otherwise behave as if we'd
+			// reached the end of the file.
+			Atoms::error e = a.errorflag;
+			a.clear();
+			a.errorflag = isLayoutError(e) ? e :
+				Atoms::error::END_OF_FILE;
+			file.clear();
+			file.seekg(0, std::ios::end);
+			return;
+		}
+
+		// there is an intact frame after this one, so it isn't still
+		// being written, it's damaged. unless recovering, report it
+		// and stay at the damaged frame.
+		if (!recover) {
+			file.clear();
+			file.seekg(offset, std::ios::beg);
+			return;
+		}
+		++resyncs;
+		bytes_skipped += found - offset;
+		seekFrame(found);
+		offset = found;
+		decodeFrame(a, offset);
+	}
+
+	if (a.errorflag == Atoms::error::NO_ERROR) {
+		pos.offset = file.tellg();
+		++pos.frame;
+	}
+}
+
+/** Wait for the next frame to be written, then read it.
+ * Intended for use in follow mode (see setFollow()) on a trajectory which is
+ * still being written. readFrame(Atoms&) is retried until it returns a
+ * frame, an error other than Atoms::error::END_OF_FILE, or the timeout
+ * expires.
+ * \param a Atoms object to populate, as for readFrame(Atoms&).
+ * \param poll How long to sleep between attempts.
+ * \param timeout How long to wait in total before giving up and returning
+ * with Atoms::error::END_OF_FILE.
+ */
+template<typename Real>
+void Trajectory::waitFrame(BasicAtoms<Real>& a, std::chrono::milliseconds poll,
+		std::chrono::milliseconds timeout)
+{
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	readFrame(a);
+	while (a.errorflag == Atoms::error::END_OF_FILE &&
+			std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(poll);
+		readFrame(a);
+	}
+}
+
+/** Apply the filter to one atom's raw data.
+ * \param row The atom's fields, in the order of the property list.
+ * \return true if the atom should be kept.
+ */
+inline bool Trajectory::accept(const double_* row) const
+{
+	if (columns.type >= 0 && !std::binary_search(filter.types.begin(),
+				filter.types.end(),
+				static_cast<int>(row[columns.type].d)))
+		return false;
+	if (columns.mol >= 0 && !std::binary_search(filter.mols.begin(),
+				filter.mols.end(),
+				static_cast<int>(row[columns.mol].d)))
+		return false;
+	if (columns.id >= 0) {
+		int id = static_cast<int>(row[columns.id].d);
+		if (id < filter.id_min || id > filter.id_max)
+			return false;
+	}
+	if (columns.x[0] >= 0) {
+		for (int i = 0; i < 3; ++i) {
+			double x = row[columns.x[i]].d;
+			if (x < filter.region_lo[i] || x > filter.region_hi[i])
+				return false;
+		}
+	}
+	return true;
+}
+
+/** Decode the frame at the current file position into a.
+ * This does the work of readFrame(Atoms&), without any error recovery.
+ * \param a Atoms object to populate.
+ * \param offset The current file position, i.e. the start of the frame.
+ */
+template<typename Real>
+void Trajectory::decodeFrame(BasicAtoms<Real>& a, std::streamoff offset)
+{
+	a.clear();
+	int nprocs = 0;
+
+	if (!readHeader(a, nprocs))
+		return;
+
+	// nothing below is sized from the file until it has been checked
+	// against what the file can actually hold, so a damaged header or
+	// block size can't make us allocate gigabytes.
+	// finding the size of the file costs a seek, which throws away the
+	// read buffer, so the last known size is used and only looked up
+	// again when something doesn't fit. that also picks up a file which
+	// has grown since (follow mode).
+	std::streamoff remaining = file_size - offset -
+		static_cast<std::streamoff>(header_size);
+	auto fits = [&](uint64_t count, std::streamoff size) {
+		if (remaining >= 0 &&
+				count <= static_cast<uint64_t>(remaining / size))
+			return true;
+		std::streamoff here = file_size - remaining;
+		remaining = fileSize() - here;
+		return remaining >= 0 &&
+			count <= static_cast<uint64_t>(remaining / size);
+	};
+	if (a.num_fields > 0 && !fits(a.n, static_cast<std::streamoff>(
+					a.num_fields * sizeof(double)))) {
+		pastEnd(a);
+		return;
+	}
+
 	// Reserve enough memory for the properties that we want and the number
 	// of atoms we're about to read. By reserving, we save a little time on
 	// allocation later (but not much, STL allocation is quick), and also
@@ -111,85 +366,88 @@ Atoms Trajectory::readFrame()
 	// (hopefully).
 	// If the file contains too many atoms, we'll get a bad_alloc exception,
 	// which we leave the caller of this function to deal with.
+	// When filtering we don't know how many atoms will be kept, so don't
+	// reserve room for all of them.
+	uint64_t reserve_n = filtering ? 0 : a.n;
 	for (auto p : properties) {
 		switch (p) {
 			case Atoms::Property::ID:
-				a.id.reserve(a.n);
+				a.id.reserve(reserve_n);
 				break;
 			case Atoms::Property::TYPE:
-				a.type.reserve(a.n);
+				a.type.reserve(reserve_n);
 				break;
 			case Atoms::Property::MOL:
-				a.mol.reserve(a.n);
+				a.mol.reserve(reserve_n);
 				break;
 			case Atoms::Property::MASS:
-				a.mass.reserve(a.n);
+				a.mass.reserve(reserve_n);
 				break;
 			case Atoms::Property::X:
-				a.x.reserve(a.n);
+				a.x.reserve(reserve_n);
 				break;
 			case Atoms::Property::Y:
-				a.x.reserve(a.n);
+				a.x.reserve(reserve_n);
 				break;
 			case Atoms::Property::Z:
-				a.x.reserve(a.n);
+				a.x.reserve(reserve_n);
 				break;
 			case Atoms::Property::XS:
-				a.xs.reserve(a.n);
+				a.xs.reserve(reserve_n);
 				break;
 			case Atoms::Property::YS:
-				a.xs.reserve(a.n);
+				a.xs.reserve(reserve_n);
 				break;
 			case Atoms::Property::ZS:
-				a.xs.reserve(a.n);
+				a.xs.reserve(reserve_n);
 				break;
 			case Atoms::Property::XU:
-				a.xu.reserve(a.n);
+				a.xu.reserve(reserve_n);
 				break;
 			case Atoms::Property::YU:
-				a.xu.reserve(a.n);
+				a.xu.reserve(reserve_n);
 				break;
 			case Atoms::Property::ZU:
-				a.xu.reserve(a.n);
+				a.xu.reserve(reserve_n);
 				break;
 			case Atoms::Property::XSU:
-				a.xsu.reserve(a.n);
+				a.xsu.reserve(reserve_n);
 				break;
 			case Atoms::Property::YSU:
-				a.xsu.reserve(a.n);
+				a.xsu.reserve(reserve_n);
 				break;
 			case Atoms::Property::ZSU:
-				a.xsu.reserve(a.n);
+				a.xsu.reserve(reserve_n);
 				break;
 			case Atoms::Property::IX:
-				a.image_flags.reserve(a.n);
+				a.image_flags.reserve(reserve_n);
 				break;
 			case Atoms::Property::IY:
-				a.image_flags.reserve(a.n);
+				a.image_flags.reserve(reserve_n);
 				break;
 			case Atoms::Property::IZ:
-				a.image_flags.reserve(a.n);
+				a.image_flags.reserve(reserve_n);
 				break;
 			case Atoms::Property::VX:
-				a.v.reserve(a.n);
+				a.v.reserve(reserve_n);
 				break;
 			case Atoms::Property::VY:
-				a.v.reserve(a.n);
+				a.v.reserve(reserve_n);
 				break;
 			case Atoms::Property::VZ:
-				a.v.reserve(a.n);
+				a.v.reserve(reserve_n);
 				break;
 			case Atoms::Property::FX:
-				a.f.reserve(a.n);
+				a.f.reserve(reserve_n);
 				break;
 			case Atoms::Property::FY:
-				a.f.reserve(a.n);
+				a.f.reserve(reserve_n);
 				break;
 			case Atoms::Property::FZ:
-				a.f.reserve(a.n);
+				a.f.reserve(reserve_n);
 				break;
 			case Atoms::Property::Q:
-				a.q.reserve(a.n);
+				a.q.reserve(reserve_n);
 				break;
 			case Atoms::Property::NULL_PROPERTY:
 				//NULL_PROPERTY needs no handling
@@ -197,101 +455,60 @@ Atoms Trajectory::readFrame()
 		}
 	}
 
-	file.read(ui.buf, sizeof(int));
-	if (file.fail()) {
-		a.errorflag = Atoms::error::FILE_ERROR;
-		return a;
-	}	
-	if (ui.i != 0) {
-		a.errorflag = Atoms::error::TRICLINIC_BOX;
-		return a;
-	}
-
-	for (int j = 0; j < 2; ++j) {
-		for (int i = 0; i < 3; ++i) {
-			file.read(ui.buf, sizeof(int));
-			if(file.fail()) {
-				a.errorflag = Atoms::error::FILE_ERROR;
-				return a;
-			}
-			if (ui.i == 0)
-				a.boxboundaries[i][j] = 'p';
-			else if (ui.i == 1)
-				a.boxboundaries[i][j] = 'f';
-			else if (ui.i == 2)
-				a.boxboundaries[i][j] = 's';
-			else if (ui.i == 3)
-				a.boxboundaries[i][j] = 'm';
-			else {
-				a.errorflag = Atoms::error::BAD_BOUNDARY;
-				return a;
-			}
-		}
-	}
-
-	std::array<double, 6> box;
-	for (int i = 0; i < 6; ++i) {
-		file.read(ud.buf, sizeof(double));
-		if (file.fail()) {
-			a.errorflag = Atoms::error::FILE_ERROR;
-			return a;
-		}
-		box[i] = ud.d;
-	}
-	a.box_lo[0] = box[0];
-	a.box_lo[1] = box[2];
-	a.box_lo[2] = box[4];
-	a.box_hi[0] = box[1];
-	a.box_hi[1] = box[3];
-	a.box_hi[2] = box[5];
-
-	file.read(ui.buf, sizeof(int));
-	if (file.fail()) {
-		a.errorflag = Atoms::error::FILE_ERROR;
-		return a;
-	}
-
-	a.num_fields = static_cast<unsigned int>(ui.i);
-	if (a.num_fields != properties.size()) {
-		a.errorflag = Atoms::error::BAD_PROPERTY_COUNT;
-		return a;
-	}
-
-	file.read(ui.buf, sizeof(int));
-	if (file.fail()) {
-		a.errorflag = Atoms::error::FILE_ERROR;
-		return a;
-	}
-	int nprocs = ui.i; //number of processors used
 
+	uint64_t atoms_read = 0;
+	uint64_t atoms_kept = 0;
 	for (int i = 0; i < nprocs; ++i) {
 		file.read(ui.buf, sizeof(int));
 		if (file.fail()) {
 			a.errorflag = Atoms::error::FILE_ERROR;
-			return a;
+			return;
 		}
 		int bufsize = ui.i; //number of doubles that follow
-		if (bufsize % a.num_fields != 0) {
+		if (bufsize < 0 || bufsize % a.num_fields != 0) {
 			// the number of atoms in this block is
 			// bufsize/num_fields. if this isn't an integer,
 			// something has gone badly wrong
 			a.errorflag = Atoms::error::FILE_CORRUPT;
-			return a;
+			return;
 		}
 		int atoms_in_block = bufsize / a.num_fields;
+		if (atoms_read + atoms_in_block > a.n) {
+			a.errorflag = Atoms::error::BAD_ATOM_COUNT;
+			return;
+		}
+		remaining -= static_cast<std::streamoff>(sizeof(int));
+		if (!fits(static_cast<uint64_t>(bufsize),
+					static_cast<std::streamoff>(
+						sizeof(double)))) {
+			pastEnd(a);
+			return;
+		}
+		remaining -= static_cast<std::streamoff>(bufsize) *
+			static_cast<std::streamoff>(sizeof(double));
 		//the vector controls a contiguous memory chunk of size
-		//bufsize*sizeof(double)
-		std::vector<double_> buffer;
-		buffer.resize(bufsize);
+		//bufsize*sizeof(double). it is kept between blocks and frames
+		//so only grows when a bigger block than before turns up
+		if (buffer.size() < static_cast<std::size_t>(bufsize))
+			buffer.resize(bufsize);
 		file.read(buffer.data()->buf, bufsize*sizeof(double));
+		if (file.fail()) {
+			a.errorflag = Atoms::error::FILE_ERROR;
+			return;
+		}
+		atoms_read += atoms_in_block;
 		//now unpack this buffer
 		for (int j = 0; j < atoms_in_block; ++j) {
-			Atoms::Vect3<double> x;
-			Atoms::Vect3<double> xs;
-			Atoms::Vect3<double> xsu;
-			Atoms::Vect3<double> xu;
-			Atoms::Vect3<double> v;
-			Atoms::Vect3<double> f;
+			if (filtering && !accept(&buffer[j*a.num_fields]))
+				continue;
+			++atoms_kept;
+
+			Atoms::Vect3<Real> x;
+			Atoms::Vect3<Real> xs;
+			Atoms::Vect3<Real> xsu;
+			Atoms::Vect3<Real> xu;
+			Atoms::Vect3<Real> v;
+			Atoms::Vect3<Real> f;
 			Atoms::Vect3<int> i;
 
 			for (unsigned int k = 0; k < a.num_fields; ++k) {
@@ -307,95 +524,95 @@ Atoms Trajectory::readFrame()
 						a.mol.emplace_back(static_cast<int>(val));
 						break;
 					case Atoms::Property::MASS:
-						a.mass.emplace_back(val);
+						a.mass.emplace_back(static_cast<Real>(val));
 						break;
 					case Atoms::Property::X:
-						x.x = val;
+						x.x = static_cast<Real>(val);
 						if (ppt.x == Atoms::Property::X)
 							a.x.emplace_back(x);
 						break;
 					case Atoms::Property::Y:
-						x.y = val;
+						x.y = static_cast<Real>(val);
 						if (ppt.x == Atoms::Property::Y)
 							a.x.emplace_back(x);
 						break;
 					case Atoms::Property::Z:
-						x.z = val;
+						x.z = static_cast<Real>(val);
 						if (ppt.x == Atoms::Property::Z)
 							a.x.emplace_back(x);
 						break;
 					case Atoms::Property::XS:
-						xs.x = val;
+						xs.x = static_cast<Real>(val);
 						if (ppt.xs == Atoms::Property::XS)
 							a.xs.emplace_back(xs);
 						break;
 					case Atoms::Property::YS:
-						xs.y = val;
+						xs.y = static_cast<Real>(val);
 						if (ppt.xs == Atoms::Property::YS)
 							a.xs.emplace_back(xs);
 						break;
 					case Atoms::Property::ZS:
-						xs.z = val;
+						xs.z = static_cast<Real>(val);
 						if (ppt.xs == Atoms::Property::ZS)
 							a.xs.emplace_back(xs);
 						break;
 					case Atoms::Property::XSU:
-						xsu.x = val;
+						xsu.x = static_cast<Real>(val);
 						if (ppt.xsu == Atoms::Property::XSU)
 							a.xsu.emplace_back(xsu);
 						break;
 					case Atoms::Property::YSU:
-						xsu.y = val;
+						xsu.y = static_cast<Real>(val);
 						if (ppt.xsu == Atoms::Property::YSU)
 							a.xsu.emplace_back(xsu);
 						break;
 					case Atoms::Property::ZSU:
-						xsu.z = val;
+						xsu.z = static_cast<Real>(val);
 						if (ppt.xsu == Atoms::Property::ZSU)
 							a.xsu.emplace_back(xsu);
 						break;
 					case Atoms::Property::XU:
-						xu.x = val;
+						xu.x = static_cast<Real>(val);
 						if (ppt.xu == Atoms::Property::XU)
 							a.xu.emplace_back(xu);
 						break;
 					case Atoms::Property::YU:
-						xu.y = val;
+						xu.y = static_cast<Real>(val);
 						if (ppt.xu == Atoms::Property::YU)
 							a.xu.emplace_back(xu);
 						break;
 					case Atoms::Property::ZU:
-						xu.z = val;
+						xu.z = static_cast<Real>(val);
 						if (ppt.xu == Atoms::Property::ZU)
 							a.xu.emplace_back(xu);
 						break;
 					case Atoms::Property::VX:
-						v.x = val;
+						v.x = static_cast<Real>(val);
 						if (ppt.v == Atoms::Property::VX)
 							a.v.emplace_back(v);
 						break;
 					case Atoms::Property::VY:
-						v.y = val;
+						v.y = static_cast<Real>(val);
 						if (ppt.v == Atoms::Property::VY)
 							a.v.emplace_back(v);
 						break;
 					case Atoms::Property::VZ:
-						v.z = val;
+						v.z = static_cast<Real>(val);
 						if (ppt.v == Atoms::Property::VZ)
 							a.v.emplace_back(v);
 						break;
 					case Atoms::Property::FX:
-						f.x = val;
+						f.x = static_cast<Real>(val);
 						if (ppt.f == Atoms::Property::FX)
 							a.f.emplace_back(f);
 						break;
 					case Atoms::Property::FY:
-						f.y = val;
+						f.y = static_cast<Real>(val);
 						if (ppt.f == Atoms::Property::FY)
 							a.f.emplace_back(f);
 						break;
 					case Atoms::Property::FZ:
-						f.z = val;
+						f.z = static_cast<Real>(val);
 						if (ppt.f == Atoms::Property::FZ)
 							a.f.emplace_back(f);
 						break;
@@ -415,7 +632,7 @@ Atoms Trajectory::readFrame()
 							a.image_flags.emplace_back(i);
 						break;
 					case Atoms::Property::Q:
-						a.q.emplace_back(val);
+						a.q.emplace_back(static_cast<Real>(val));
 						break;
 					case Atoms::Property::NULL_PROPERTY:
 						//NULL_PROPERTY needs no handling
@@ -425,5 +642,532 @@ Atoms Trajectory::readFrame()
 		}
 		
 	}
-	return a;
+	if (atoms_read != a.n)
+		a.errorflag = Atoms::error::BAD_ATOM_COUNT;
+	a.n = atoms_kept;
+}
+
+/** Find the byte offset of every complete frame in the trajectory.
+ * Only the frame headers and block sizes are read; the atom data is skipped
+ * over, so this is much quicker than reading the whole trajectory. The scan
+ * stops at the first frame which is incomplete or fails to read. The file
+ * position is restored afterwards.
+ * \return Offsets from the start of the file, one per frame, in file order.
+ */
+std::vector<std::streamoff> Trajectory::scanFrames()
+{
+	std::streamoff stopped;
+	return scanFrames(stopped);
+}
+
+/** Find the byte offset of every complete frame, as scanFrames(), and say
+ * where the scan stopped.
+ * \param stopped Set to the offset of the frame which failed to read, or -1
+ * if the scan reached the end of the file.
+ */
+std::vector<std::streamoff> Trajectory::scanFrames(std::streamoff& stopped)
+{
+	std::vector<std::streamoff> offsets;
+	stopped = -1;
+
+	if (!file.is_open())
+		return offsets;
+
+	file.clear();
+	std::streampos start = file.tellg();
+	std::streamoff filesize = fileSize();
+	file.seekg(0, std::ios::beg);
+
+	while (true) {
+		std::streamoff offset = file.tellg();
+		AtomsBase a;
+		if (!skipFrame(a, filesize)) {
+			if (offset < filesize)
+				stopped = offset;
+			break;
+		}
+		offsets.push_back(offset);
+	}
+
+	file.clear();
+	file.seekg(start);
+	return offsets;
+}
+
+/** Check the structure of every frame in the trajectory without decoding any
+ * atom data.
+ * Each frame header is read and the block sizes are checked against the
+ * number of fields, the atom count and the size of the file; timesteps must
+ * not go backwards. After a damaged frame the search resumes at the next
+ * intact frame header, so one bad region doesn't hide the rest of the file.
+ * The file position is restored afterwards.
+ * \return One entry per frame or damaged region, in file order. Entries
+ * with an error other than Atoms::error::NO_ERROR mark the problems.
+ */
+std::vector<Trajectory::FrameInfo> Trajectory::validate()
+{
+	std::vector<FrameInfo> frames;
+
+	if (!file.is_open())
+		return frames;
+
+	file.clear();
+	std::streampos start = file.tellg();
+	std::streamoff filesize = fileSize();
+
+	std::streamoff offset = 0;
+	bool have_timestep = false;
+	uint64_t last_timestep = 0;
+	std::streamoff searched = 0;
+	while (offset < filesize) {
+		file.clear();
+		file.seekg(offset, std::ios::beg);
+		AtomsBase a;
+		bool ok = skipFrame(a, filesize);
+
+		FrameInfo info;
+		info.offset = offset;
+		info.timestep = a.timestep;
+		info.n = a.n;
+		info.error = a.errorflag;
+		if (info.error == Atoms::error::END_OF_FILE) {
+			// a few stray bytes at the end, too short for a header
+			info.error = Atoms::error::FILE_ERROR;
+		}
+		if (ok && have_timestep && a.timestep < last_timestep)
+			info.error = Atoms::error::BAD_TIMESTEP;
+		frames.push_back(info);
+
+		if (ok) {
+			// a timestep going backwards is suspicious but the
+			// frame itself is intact, so carry on from there
+			have_timestep = true;
+			last_timestep = a.timestep;
+			offset = file.tellg();
+		} else if (!resync(offset + 1, filesize, offset, searched)) {
+			break;
+		}
+	}
+
+	file.clear();
+	file.seekg(start);
+	return frames;
+}
+
+/** Only keep atoms which pass the given filter.
+ * The tests are applied to the raw data as each frame is decoded, so atoms
+ * which fail are never stored and Atoms::n counts only the atoms kept. Pass
+ * a default constructed Filter to keep every atom again.
+ * \param filter The tests to apply.
+ * \return false if the filter tests a property which isn't in the property
+ * list, in which case the filter is not applied.
+ */
+bool Trajectory::setFilter(const Filter& filter)
+{
+	bool by_id = filter.id_min != std::numeric_limits<int>::min() ||
+		filter.id_max != std::numeric_limits<int>::max();
+	bool by_region = false;
+	for (int i = 0; i < 3; ++i) {
+		if (filter.region_lo[i] != -HUGE_VAL ||
+				filter.region_hi[i] != HUGE_VAL)
+			by_region = true;
+	}
+
+	// find the column holding each property we need to test
+	auto column = [&](Atoms::Property p) {
+		auto it = std::find(properties.begin(), properties.end(), p);
+		return it == properties.end() ? -1 :
+			static_cast<int>(it - properties.begin());
+	};
+	FilterColumns c;
+	c.id = column(Atoms::Property::ID);
+	c.type = column(Atoms::Property::TYPE);
+	c.mol = column(Atoms::Property::MOL);
+	c.x[0] = column(Atoms::Property::X);
+	c.x[1] = column(Atoms::Property::Y);
+	c.x[2] = column(Atoms::Property::Z);
+
+	if ((by_id && c.id < 0) ||
+			(!filter.types.empty() && c.type < 0) ||
+			(!filter.mols.empty() && c.mol < 0) ||
+			(by_region && (c.x[0] < 0 || c.x[1] < 0 || c.x[2] < 0)))
+		return false;
+
+	// columns for tests that aren't in use are left out, so accept()
+	// skips them
+	if (!by_id)
+		c.id = -1;
+	if (filter.types.empty())
+		c.type = -1;
+	if (filter.mols.empty())
+		c.mol = -1;
+	if (!by_region)
+		c.x[0] = -1;
+
+	this->filter = filter;
+	std::sort(this->filter.types.begin(), this->filter.types.end());
+	std::sort(this->filter.mols.begin(), this->filter.mols.end());
+	columns = c;
+	filtering = by_id || by_region || !filter.types.empty() ||
+		!filter.mols.empty();
+	return true;
+}
+
+/** Turn recovery mode on or off. In recovery mode, readFrame() skips over
+ * damaged or truncated frames to the next intact frame instead of returning
+ * an error. Errors which indicate that the file doesn't match the expected
+ * layout (Atoms::error::TRICLINIC_BOX and Atoms::error::BAD_PROPERTY_COUNT)
+ * are still returned if they occur in the first frame, or if no intact frame
+ * follows them. Use resyncCount() and bytesSkipped() to find out how much
+ * was lost.
+ * \param on true to enable recovery mode.
+ */
+void Trajectory::setRecovery(bool on)
+{
+	recover = on;
+}
+
+/** Turn follow mode on or off. In follow mode the trajectory is assumed to
+ * be still growing: a frame which is only partly written is not an error.
+ * readFrame() returns Atoms::error::END_OF_FILE and stays at the start of
+ * that frame, so calling it again later picks up the frame once the
+ * simulation has finished writing it. See also waitFrame().
+ * \param on true to enable follow mode.
+ */
+void Trajectory::setFollow(bool on)
+{
+	follow = on;
+}
+
+/** Continue reading from a previously saved position.
+ * The file is checked to make sure a frame really starts there, in case it
+ * has been rewritten or replaced since the position was saved. A frame which
+ * is still being written counts, provided its header is complete.
+ * \param p Position as returned by position(), possibly from an earlier
+ * run.
+ * \return false if the file isn't open or no frame starts at the saved
+ * offset, in which case the position is unchanged.
+ */
+bool Trajectory::resume(const Position& p)
+{
+	if (!file.is_open())
+		return false;
+
+	file.clear();
+	std::streampos current = file.tellg();
+	if (!isFrameStart(p.offset)) {
+		file.clear();
+		file.seekg(current);
+		return false;
+	}
+
+	seekFrame(p.offset);
+	pos = p;
+	resync_frame = -1;
+	return true;
+}
+
+/** Write the current position to a file, so that a later run can carry on
+ * from here with loadPosition(). Save it together with any analysis results
+ * accumulated so far.
+ * \param statefile Name of the file to write.
+ * \return false if the file couldn't be written.
+ */
+bool Trajectory::savePosition(const std::string& statefile) const
+{
+	std::ofstream out(statefile.c_str());
+	out << pos.offset << " " << pos.frame << std::endl;
+	return !out.fail();
+}
+
+/** Read a position written by savePosition() and resume() from it.
+ * \param statefile Name of the file to read.
+ * \return false if the file couldn't be read or the saved position isn't
+ * the start of a frame (see resume()), in which case the position is
+ * unchanged.
+ */
+bool Trajectory::loadPosition(const std::string& statefile)
+{
+	std::ifstream in(statefile.c_str());
+	Position p;
+	in >> p.offset >> p.frame;
+	if (in.fail())
+		return false;
+	return resume(p);
+}
+
+/** Move to the frame starting at the given offset, so that the next call to
+ * readFrame() reads it.
+ * \param offset Offset from the start of the file, as returned by
+ * scanFrames().
+ * \return false if the file isn't open or the seek failed.
+ */
+bool Trajectory::seekFrame(std::streamoff offset)
+{
+	if (!file.is_open())
+		return false;
+	file.clear();
+	file.seekg(offset, std::ios::beg);
+	return !file.fail();
+}
+
+/** Whether recovery mode should try to skip past a frame with this error.
+ * \param e The error from reading the frame.
+ * \param offset Offset of the frame. Layout errors in the first frame of the
+ * file are taken at face value, anywhere else they are most likely damage.
+ */
+bool Trajectory::isRecoverable(Atoms::error e, std::streamoff offset) const
+{
+	switch (e) {
+		case Atoms::error::FILE_ERROR:
+		case Atoms::error::BAD_BOUNDARY:
+		case Atoms::error::FILE_CORRUPT:
+		case Atoms::error::BAD_ATOM_COUNT:
+			return file.is_open();
+		case Atoms::error::TRICLINIC_BOX:
+		case Atoms::error::BAD_PROPERTY_COUNT:
+			return file.is_open() && offset > 0;
+		default:
+			return false;
+	}
+}
+
+/** Whether an error says the file doesn't have the expected layout, rather
+ * than that it is damaged. */
+bool Trajectory::isLayoutError(Atoms::error e)
+{
+	return e == Atoms::error::TRICLINIC_BOX ||
+		e == Atoms::error::BAD_PROPERTY_COUNT;
+}
+
+/** Whether a frame starts at offset, or the file ends there so that the next
+ * frame would start there once written. Moves the file position. */
+bool Trajectory::isFrameStart(std::streamoff offset)
+{
+	std::streamoff filesize = fileSize();
+	if (offset < 0 || offset > filesize)
+		return false;
+	if (offset == filesize)
+		return true;
+
+	AtomsBase a;
+	file.seekg(offset, std::ios::beg);
+	if (skipFrame(a, filesize))
+		return true;
+
+	// a frame which is only partly written fails skipFrame(), but its
+	// header can still be checked
+	if (a.errorflag != Atoms::error::FILE_ERROR ||
+			offset + static_cast<std::streamoff>(header_size) >
+			filesize)
+		return false;
+	char header[header_size];
+	file.clear();
+	file.seekg(offset, std::ios::beg);
+	file.read(header, header_size);
+	return !file.fail() && plausibleHeader(header);
 }
+
+/** Whether a frame failed to read only because the file ended partway
+ * through it. */
+bool Trajectory::isIncomplete(const AtomsBase& a) const
+{
+	return file.eof() && (a.errorflag == Atoms::error::END_OF_FILE ||
+			a.errorflag == Atoms::error::FILE_ERROR);
+}
+
+/** Report that no complete frame is available yet, and go back to offset
+ * to try again on the next read. */
+template<typename Real>
+void Trajectory::rewind(BasicAtoms<Real>& a, std::streamoff offset)
+{
+	a.clear();
+	a.errorflag = Atoms::error::END_OF_FILE;
+	file.clear();
+	file.seekg(offset, std::ios::beg);
+}
+
+/** Report that the frame runs past the end of the file. The stream is left
+ * as a read past the end would have left it, so that isIncomplete() treats
+ * the frame as still being written. */
+void Trajectory::pastEnd(AtomsBase& a)
+{
+	a.errorflag = Atoms::error::FILE_ERROR;
+	file.setstate(std::ios::eofbit | std::ios::failbit);
+}
+
+/** Size of the trajectory file in bytes, which is also remembered in
+ * file_size. The file position is unchanged. */
+std::streamoff Trajectory::fileSize()
+{
+	file.clear();
+	std::streampos pos = file.tellg();
+	file.seekg(0, std::ios::end);
+	file_size = file.tellg();
+	file.seekg(pos);
+	return file_size;
+}
+
+/** Read the frame at the current file position, checking its structure but
+ * skipping over the atom data.
+ * \param a Atoms object to receive the header fields. On failure its
+ * errorflag is set.
+ * \param filesize Size of the file, used to spot truncated frames.
+ * \return true if the frame is intact, leaving the file at the start of the
+ * following frame.
+ */
+bool Trajectory::skipFrame(AtomsBase& a, std::streamoff filesize)
+{
+	int nprocs = 0;
+	if (!readHeader(a, nprocs))
+		return false;
+
+	uint64_t atoms = 0;
+	for (int i = 0; i < nprocs; ++i) {
+		file.read(ui.buf, sizeof(int));
+		if (file.fail()) {
+			a.errorflag = Atoms::error::FILE_ERROR;
+			return false;
+		}
+		int bufsize = ui.i;
+		if (bufsize < 0 || bufsize % a.num_fields != 0) {
+			a.errorflag = Atoms::error::FILE_CORRUPT;
+			return false;
+		}
+		atoms += bufsize / a.num_fields;
+		file.seekg(static_cast<std::streamoff>(bufsize) * sizeof(double),
+				std::ios::cur);
+		if (file.tellg() > filesize) {
+			a.errorflag = Atoms::error::FILE_ERROR;
+			return false;
+		}
+	}
+
+	if (atoms != a.n) {
+		a.errorflag = Atoms::error::BAD_ATOM_COUNT;
+		return false;
+	}
+	return true;
+}
+
+/** Search for the next intact frame after the damaged or incomplete frame at
+ * offset. If an earlier search from the same frame ran out of data, this one
+ * carries on from where it stopped, so repeated calls while waiting for more
+ * data only scan what has been appended.
+ * \param offset Start of the frame which couldn't be read.
+ * \param found Set to the offset of the next intact frame, if there is one.
+ * \return true if an intact frame was found.
+ */
+bool Trajectory::findNext(std::streamoff offset, std::streamoff& found)
+{
+	std::streamoff from = offset + 1;
+	if (offset == resync_frame)
+		from = std::max(from, resync_next);
+	if (resync(from, fileSize(), found, resync_next)) {
+		resync_frame = -1;
+		return true;
+	}
+	resync_frame = offset;
+	return false;
+}
+
+/** Quick test of whether a frame header could start at p, before the more
+ * expensive check done by skipFrame(). p must point to at least
+ * header_size bytes.
+ */
+bool Trajectory::plausibleHeader(const char* p)
+{
+	p += 2*sizeof(int64_t); //timestep and number of atoms can be anything
+	
+	std::memcpy(ui.buf, p, sizeof(int));
+	p += sizeof(int);
+	if (ui.i != 0) //triclinic
+		return false;
+
+	for (int i = 0; i < 6; ++i) {
+		std::memcpy(ui.buf, p, sizeof(int));
+		p += sizeof(int);
+		if (ui.i < 0 || ui.i > 3) //boundary type
+			return false;
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		double lo, hi;
+		std::memcpy(ud.buf, p, sizeof(double));
+		lo = ud.d;
+		std::memcpy(ud.buf, p + sizeof(double), sizeof(double));
+		hi = ud.d;
+		p += 2*sizeof(double);
+		if (!(lo <= hi)) //also rejects NaN
+			return false;
+	}
+
+	std::memcpy(ui.buf, p, sizeof(int));
+	p += sizeof(int);
+	if (static_cast<unsigned int>(ui.i) != properties.size())
+		return false;
+
+	std::memcpy(ui.buf, p, sizeof(int));
+	return ui.i > 0; //number of processor blocks
+}
+
+/** Search forward for the next intact frame.
+ * The file is read in large chunks and every byte offset is tested as a
+ * possible frame start, so this runs at close to disk speed.
+ * \param from Offset at which to start searching.
+ * \param filesize Size of the file.
+ * \param found Set to the offset of the frame, if one is found.
+ * \param searched If no frame is found, set to the first offset which
+ * hasn't been ruled out. Offsets before it can't start a frame even once
+ * more data has been appended, so a later search can start there.
+ * \return true if an intact frame was found.
+ */
+bool Trajectory::resync(std::streamoff from, std::streamoff filesize,
+		std::streamoff& found, std::streamoff& searched)
+{
+	const std::streamoff chunk = 1 << 20;
+	std::vector<char> window(chunk + header_size);
+	// first candidate which only failed because it ran off the end of
+	// the file, and so might yet turn out to be intact
+	std::streamoff pending = -1;
+
+	for (std::streamoff base = from; base + static_cast<std::streamoff>(
+				header_size) <= filesize; base += chunk) {
+		file.clear();
+		file.seekg(base, std::ios::beg);
+		file.read(window.data(), window.size());
+		std::streamoff got = file.gcount();
+
+		for (std::streamoff i = 0; i < chunk &&
+				i + static_cast<std::streamoff>(header_size)
+				<= got; ++i) {
+			if (!plausibleHeader(window.data() + i))
+				continue;
+			AtomsBase a;
+			file.clear();
+			file.seekg(base + i, std::ios::beg);
+			if (skipFrame(a, filesize)) {
+				found = base + i;
+				return true;
+			}
+			if (pending < 0 &&
+					a.errorflag == Atoms::error::FILE_ERROR)
+				pending = base + i;
+		}
+	}
+
+	if (pending >= 0)
+		searched = pending;
+	else
+		searched = std::max(from, filesize -
+				static_cast<std::streamoff>(header_size) + 1);
+	return false;
+}
+
+
+template void Trajectory::readFrame(Atoms&);
+template void Trajectory::readFrame(AtomsF&);
+template void Trajectory::waitFrame(Atoms&, std::chrono::milliseconds,
+		std::chrono::milliseconds);
+template void Trajectory::waitFrame(AtomsF&, std::chrono::milliseconds,
+		std::chrono::milliseconds);
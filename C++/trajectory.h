@@ -1,9 +1,15 @@
 #ifndef TRAJECTORY_H
 #define TRAJECTORY_H
 
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <limits>
 #include <string>
+#include <vector>
 
 #include "atoms.h"
 
@@ -15,11 +21,103 @@
  */
 class Trajectory {
 public:
+	/** Summary of one frame, as found by validate() */
+	struct FrameInfo {
+		/** Offset of the frame from the start of the file */
+		std::streamoff offset;
+		/** Timestep from the frame header */
+		uint64_t timestep;
+		/** Number of atoms from the frame header */
+		uint64_t n;
+		/** Atoms::error::NO_ERROR if the frame is intact */
+		Atoms::error error;
+	};
+
+	/** Where reading has got to, for resuming later */
+	struct Position {
+		/** Offset of the next frame from the start of the file */
+		std::streamoff offset;
+		/** Number of frames read before this point */
+		uint64_t frame;
+
+		Position() : offset(0), frame(0) {}
+	};
+
+	/** Selects the atoms kept by readFrame(), see setFilter(). An atom is
+	 * kept only if it passes every test. The defaults keep every atom. */
+	struct Filter {
+		/** Atom types to keep, or empty to keep all types */
+		std::vector<int> types;
+		/** Molecule IDs to keep, or empty to keep all molecules */
+		std::vector<int> mols;
+		/** Smallest atom ID to keep */
+		int id_min;
+		/** Largest atom ID to keep */
+		int id_max;
+		/** Lower corner of the box (x, y, z) within which atoms are
+		 * kept */
+		std::array<double, 3> region_lo;
+		/** Upper corner of the box (x, y, z) within which atoms are
+		 * kept */
+		std::array<double, 3> region_hi;
+
+		Filter()
+			: id_min(std::numeric_limits<int>::min()),
+			id_max(std::numeric_limits<int>::max()),
+			region_lo{{-HUGE_VAL, -HUGE_VAL, -HUGE_VAL}},
+			region_hi{{HUGE_VAL, HUGE_VAL, HUGE_VAL}} {}
+	};
 
 	Trajectory(const std::string&, const std::vector<Atoms::Property>&);
 
 	Atoms readFrame(); 
+	template<typename Real>
+	void readFrame(BasicAtoms<Real>&);
+	std::vector<std::streamoff> scanFrames();
+	std::vector<std::streamoff> scanFrames(std::streamoff&);
+	bool seekFrame(std::streamoff);
+	std::vector<FrameInfo> validate();
+
+	bool setFilter(const Filter&);
+
+	void setRecovery(bool);
+	/** Number of times recovery mode has skipped over damaged data */
+	uint64_t resyncCount() const { return resyncs; }
+	/** Number of bytes of damaged data skipped in recovery mode */
+	std::streamoff bytesSkipped() const { return bytes_skipped; }
+
+	void setFollow(bool);
+	template<typename Real>
+	void waitFrame(BasicAtoms<Real>&, std::chrono::milliseconds,
+			std::chrono::milliseconds);
+	/** Position just after the last frame successfully read */
+	Position position() const { return pos; }
+	bool resume(const Position&);
+	bool savePosition(const std::string&) const;
+	bool loadPosition(const std::string&);
 private:
+	/** Size in bytes of a frame header, up to the first processor block */
+	static const std::size_t header_size = 2*sizeof(int64_t) +
+		9*sizeof(int) + 6*sizeof(double);
+
+	bool readHeader(AtomsBase&, int&);
+	template<typename Real>
+	void decodeFrame(BasicAtoms<Real>&, std::streamoff);
+	bool skipFrame(AtomsBase&, std::streamoff);
+	bool plausibleHeader(const char*);
+	bool resync(std::streamoff, std::streamoff, std::streamoff&,
+			std::streamoff&);
+	bool findNext(std::streamoff, std::streamoff&);
+	bool isRecoverable(Atoms::error, std::streamoff) const;
+	static bool isLayoutError(Atoms::error);
+	bool isFrameStart(std::streamoff);
+	bool isIncomplete(const AtomsBase&) const;
+	void pastEnd(AtomsBase&);
+	template<typename Real>
+	void rewind(BasicAtoms<Real>&, std::streamoff);
+	std::streamoff fileSize();
+
+
 	/** Used for reading the LAMMPS bigint type */
 	union bigint_ {
 		char buf[sizeof(int64_t)];
@@ -59,11 +157,49 @@ private:
 			i(Atoms::Property::NULL_PROPERTY) {}
 	} ppt;
 
+	/** Columns of the property list tested by the filter, -1 if the
+	 * corresponding test is not in use. */
+	struct FilterColumns {
+		int id;
+		int type;
+		int mol;
+		std::array<int, 3> x;
+
+		FilterColumns() : id(-1), type(-1), mol(-1), x{{-1, -1, -1}} {}
+	} columns;
+
+	bool accept(const double_*) const;
+
+	/** Scratch space holding the raw doubles of one processor block */
+	std::vector<double_> buffer;
+
 	/** Name of the trajectory file to read from. */
 	const std::string filename;
 	/** List of the properties to read for each atom */
 	const std::vector<Atoms::Property>& properties;
 	std::ifstream file;
+
+	/** Skip damaged frames rather than returning an error */
+	bool recover;
+	/** Wait for partly written frames rather than returning an error */
+	bool follow;
+	/** Whether a filter is in use */
+	bool filtering;
+	/** Filter set by setFilter(), with its lists sorted */
+	Filter filter;
+	/** Position after the last frame read */
+	Position pos;
+	/** Number of times damaged data has been skipped */
+	uint64_t resyncs;
+	/** Total bytes of damaged data skipped */
+	std::streamoff bytes_skipped;
+	/** Damaged or incomplete frame whose search for the next intact
+	 * frame ran out of data, or -1 */
+	std::streamoff resync_frame;
+	/** Where to carry on that search from */
+	std::streamoff resync_next;
+	/** Size of the file when last looked up by fileSize() */
+	std::streamoff file_size;
 };
 
 #endif